@@ -13,9 +13,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 
-// _XOPEN_SOURCE is needed for strptime from time.h
-#define _XOPEN_SOURCE
-
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,11 +31,31 @@
 
 #define MAX(a, b) ((a > b) ? a : b)
 #define MIN(a, b) ((a < b) ? a : b)
+#define CLAMP(x, lo, hi) MIN(MAX(x, lo), hi)
 
 #define CONFIG_FILE ".cweather"
 #define DEFAULT_LOCATION "-37.8136,144.9631"
 #define DEFAULT_INTERVAL 300
 #define MINIMUM_INTERVAL 60
+#define HOURLY_TTL 900
+#define MAX_HOURS 25
+#define HOURLY_BUFFER (1024 * 256)
+#define FETCH_CONNECT_TIMEOUT 10
+#define FETCH_TIMEOUT 30
+#define DEFAULT_CONCURRENCY 8
+#define DEFAULT_RATE 10
+#define BATCH_RETRIES 3
+#define BATCH_BUFFER (1024 * 100)
+#define BATCH_LOW_SPEED 100
+#define BATCH_LOW_SPEED_TIME 10
+
+#define ARENA_ALIGN 16
+#define ARENA_MIN_SIZE (1024 * 256)
+#define INTERN_POOL_SIZE (1024 * 4)
+#define INTERN_MAX 256
+#define CODE_MAX 32
+#define FORECAST_TEXT_MIN (1024 * 4)
+#define FORECAST_TEXT_MAX 65535
 
 const char ICON_UNKNOWN[] =
     "      -----\n"
@@ -148,34 +166,329 @@ unsigned int buf_write_cb(char *in, unsigned int len, unsigned int nmemb,
   return r;
 }
 
+// every heap allocation a refresh can make goes through these: the JSON arena,
+// the intern pool, forecast text, and curl (by way of curl_global_init_mem).
+// The main loop takes the difference across a refresh and shows it.
+unsigned long heap_allocs;
+
+void *counted_malloc(size_t size) {
+  heap_allocs++;
+  return malloc(size);
+}
+
+void *counted_calloc(size_t n, size_t size) {
+  heap_allocs++;
+  return calloc(n, size);
+}
+
+void *counted_realloc(void *p, size_t size) {
+  heap_allocs++;
+  return realloc(p, size);
+}
+
+char *counted_strdup(const char *s) {
+  heap_allocs++;
+  return strdup(s);
+}
+
+void counted_free(void *p) {
+  free(p);
+}
+
+// the synchronous fetches share one easy handle so that its connections,
+// DNS cache and buffers carry over from one refresh to the next.
+CURL *fetch_handle;
+
 int fetch_json(char *url, struct buf_s *buf) {
-  CURL *ch;
+  CURLcode rc;
+
+  if (fetch_handle == NULL) {
+    if ((fetch_handle = curl_easy_init()) == NULL) {
+      return -1;
+    }
+
+    curl_easy_setopt(fetch_handle, CURLOPT_WRITEFUNCTION, buf_write_cb);
+    curl_easy_setopt(fetch_handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(fetch_handle, CURLOPT_CONNECTTIMEOUT,
+                     (long)FETCH_CONNECT_TIMEOUT);
+    curl_easy_setopt(fetch_handle, CURLOPT_TIMEOUT, (long)FETCH_TIMEOUT);
+  }
+
+  curl_easy_setopt(fetch_handle, CURLOPT_URL, url);
+  curl_easy_setopt(fetch_handle, CURLOPT_WRITEDATA, buf);
+  rc = curl_easy_perform(fetch_handle);
+
+  return rc == CURLE_OK ? 0 : -1;
+}
+
+// jansson is pointed at a bump arena so that parsing a response doesn't turn
+// into thousands of little mallocs. Everything it allocates is thrown away in
+// one go by arena_reset, which also grows the arena to fit the biggest
+// response seen so far. Once that's happened, JSON parsing doesn't touch the
+// heap.
+struct arena_chunk_s {
+  struct arena_chunk_s *next;
+};
+
+struct arena_s {
+  size_t cap, len, overflow;
+  char *data;
+  struct arena_chunk_s *chunks;
+};
+
+struct arena_s json_arena;
+
+void *arena_alloc(size_t size) {
+  struct arena_s *a = &json_arena;
+  struct arena_chunk_s *c;
+  void *p;
+
+  size = (size + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+
+  if (a->len + size <= a->cap) {
+    p = &(a->data[a->len]);
+    a->len += size;
+    return p;
+  }
+
+  // the arena is too small (or cold), so spill to the heap for now and
+  // remember how much we needed for the next reset
+  if ((c = counted_malloc(ARENA_ALIGN + size)) == NULL) {
+    return NULL;
+  }
+
+  a->overflow += size;
+
+  c->next = a->chunks;
+  a->chunks = c;
+
+  return (char *)c + ARENA_ALIGN;
+}
+
+void arena_free(void *p) {
+  // everything is released by arena_reset
+}
+
+void arena_reset(struct arena_s *a) {
+  struct arena_chunk_s *c;
+  size_t want;
+  char *d;
+
+  while ((c = a->chunks) != NULL) {
+    a->chunks = c->next;
+    free(c);
+  }
+
+  want = a->len + a->overflow;
+  if (want > a->cap) {
+    want += want / 4;
+    want = MAX(want, ARENA_MIN_SIZE);
+
+    if ((d = counted_realloc(a->data, want)) != NULL) {
+      a->data = d;
+      a->cap = want;
+    }
+  }
+
+  a->len = 0;
+  a->overflow = 0;
+}
+
+// short strings that repeat from one refresh to the next (phrases, compass
+// directions, weekdays) are interned here instead of being copied around. The
+// pool is never freed. It grows a block at a time as new strings turn up, and
+// stops growing once it has seen the vocabulary the API uses.
+struct intern_block_s {
+  struct intern_block_s *next;
+  size_t cap, len;
+  char data[];
+};
+
+struct intern_s {
+  struct intern_block_s *blocks;
+  int count, cap;
+  const char **strings;
+};
+
+struct intern_s intern_pool;
+
+const char *intern(const char *s, size_t l) {
+  struct intern_s *p = &intern_pool;
+  struct intern_block_s *b;
+  const char **strings;
+  size_t cap;
+  char *d;
+  int i;
+
+  for (i = 0; i < p->count; i++) {
+    if (strncmp(p->strings[i], s, l) == 0 && p->strings[i][l] == '\0') {
+      return p->strings[i];
+    }
+  }
+
+  if (p->count == p->cap) {
+    cap = MAX(p->cap * 2, INTERN_MAX);
+
+    if ((strings = counted_realloc(p->strings, sizeof(char *) * cap)) ==
+        NULL) {
+      fprintf(stderr, "intern(): out of memory\n");
+      exit(1);
+    }
 
-  ch = curl_easy_init();
+    p->strings = strings;
+    p->cap = cap;
+  }
+
+  if ((b = p->blocks) == NULL || b->len + l + 1 > b->cap) {
+    cap = MAX(l + 1, INTERN_POOL_SIZE);
+
+    if ((b = counted_malloc(sizeof(struct intern_block_s) + cap)) == NULL) {
+      fprintf(stderr, "intern(): out of memory\n");
+      exit(1);
+    }
+
+    b->cap = cap;
+    b->len = 0;
+    b->next = p->blocks;
+    p->blocks = b;
+  }
+
+  d = &(b->data[b->len]);
+  memcpy(d, s, l);
+  d[l] = '\0';
+
+  b->len += l + 1;
+  p->strings[p->count++] = d;
+
+  return d;
+}
+
+// the short strings that keep turning up in responses (compass points, types
+// of precipitation and so on) are stored as one byte codes into these tables.
+// Anything we haven't seen before is added the first time it turns up. These
+// are all small, closed sets; a full table means the API has changed, so it's
+// reported as an error rather than written out as something else.
+struct codes_s {
+  const char *name;
+  int count;
+  const char *names[CODE_MAX];
+};
+
+struct codes_s compass_codes = {
+    "windDirCompass",
+    19,
+    {"", "N", "NNE", "NE", "ENE", "E", "ESE", "SE", "SSE", "S", "SSW", "SW",
+     "WSW", "W", "WNW", "NW", "NNW", "CALM", "VAR"},
+};
+
+struct codes_s precip_type_codes = {
+    "precipType",
+    4,
+    {"", "rain", "snow", "precip"},
+};
+
+struct codes_s uv_description_codes = {
+    "uvDescription",
+    7,
+    {"", "Low", "Moderate", "High", "Very High", "Extreme", "Not Available"},
+};
+
+struct codes_s thunder_enum_phrase_codes = {
+    "thunderEnumPhrase",
+    7,
+    {"", "No thunder", "Thunder possible", "Thunder expected",
+     "Severe thunderstorms possible", "Severe thunderstorms likely",
+     "High risk of severe thunderstorms"},
+};
+
+int code(struct codes_s *c, const char *s, size_t l) {
+  int i;
+
+  for (i = 0; i < c->count; i++) {
+    if (strncmp(c->names[i], s, l) == 0 && c->names[i][l] == '\0') {
+      return i;
+    }
+  }
+
+  if (c->count == CODE_MAX) {
+    fprintf(stderr, "%s: too many distinct values, can't add \"%.*s\"\n",
+            c->name, (int)l, s);
+    return -1;
+  }
+
+  c->names[c->count] = intern(s, l);
+
+  return c->count++;
+}
 
-  curl_easy_setopt(ch, CURLOPT_URL, url);
+// timestamps look like 2019-03-05T07:12:00+1100. They're kept as UTC epoch
+// seconds, and the offset is kept as well so that they can be shown in the
+// forecast location's time rather than ours.
+int parse_time(const char *s, time_t *t, int *offset) {
+  int y, mo, d, h, mi, sec, o, n;
+  long era, yoe, doy, doe;
 
-  curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, buf_write_cb);
-  curl_easy_setopt(ch, CURLOPT_WRITEDATA, buf);
-  curl_easy_setopt(ch, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_perform(ch);
-  curl_easy_cleanup(ch);
+  if (sscanf(s, "%4d-%2d-%2dT%2d:%2d:%2d%n", &y, &mo, &d, &h, &mi, &sec,
+             &n) != 6) {
+    return -1;
+  }
+
+  s += n;
+
+  // the offset is +hh, +hhmm or +hh:mm. Each digit is checked before moving
+  // past it so that a truncated offset can't walk off the end of the string.
+  o = 0;
+  if (s[0] == '+' || s[0] == '-') {
+    if (!isdigit((unsigned char)s[1]) || !isdigit((unsigned char)s[2])) {
+      return -1;
+    }
+
+    o = ((s[1] - '0') * 10 + (s[2] - '0')) * 3600;
+
+    n = s[3] == ':' ? 4 : 3;
+    if (n == 4 || isdigit((unsigned char)s[n])) {
+      if (!isdigit((unsigned char)s[n]) || !isdigit((unsigned char)s[n + 1])) {
+        return -1;
+      }
+
+      o += ((s[n] - '0') * 10 + (s[n + 1] - '0')) * 60;
+    }
+
+    if (s[0] == '-') {
+      o = -o;
+    }
+  }
+
+  *offset = o;
+
+  // days since 1970-01-01, see http://howardhinnant.github.io/date_algorithms
+  y -= mo <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (mo > 2 ? mo - 3 : mo + 9) + 2) / 5 + d - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+  *t = (era * 146097 + doe - 719468) * 86400 + h * 3600 + mi * 60 + sec -
+       *offset;
 
   return 0;
 }
 
+void location_time(time_t t, int offset, struct tm *tm) {
+  t += offset;
+  gmtime_r(&t, tm);
+}
+
+long day_number(time_t t, int offset) { return (t + offset) / 86400; }
+
 struct observation_s {
-  int ready;
-  char phrase[50];
-  int temperature, temperature_min, temperature_max;
-  int feels_like;
-  int humidity;
-  char wind_direction_compass[5];
-  int wind_direction_degrees;
-  int wind_speed;
-  double visibility;
-  int uv_index;
-  char uv_description[50];
+  unsigned char ready;
+  signed char temperature, temperature_min, temperature_max, feels_like;
+  unsigned char humidity, wind_speed, uv_index;
+  unsigned char wind_direction_compass, uv_description;
+  unsigned short wind_direction_degrees;
+  float visibility;
+  const char *phrase;
 };
 
 int fetch_observation(const char location[],
@@ -187,6 +500,10 @@ int fetch_observation(const char location[],
   json_error_t err;
   char *s1, *s2, *s3;
   size_t l1, l2, l3;
+  int temperature, temperature_max, feels_like, humidity;
+  int wind_direction_degrees, wind_speed, uv_index;
+  int wind_direction_compass, uv_description;
+  double visibility;
 
   memset(url, 0, sizeof(url));
   memset(data, 0, sizeof(data));
@@ -209,102 +526,163 @@ int fetch_observation(const char location[],
   r = json_loads(b.data, 0, &err);
 
   if (!r || !json_is_object(r)) {
-    json_decref(r);
+    arena_reset(&json_arena);
     return -1;
   }
 
   o = json_object_get(r, "vt1observation");
   if (!o || !json_is_object(o)) {
-    json_decref(r);
+    arena_reset(&json_arena);
     return -1;
   }
 
   memset(observation, 0, sizeof(struct observation_s));
+  observation->phrase = intern("", 0);
 
   rc = json_unpack(
       o, "{s:s% s:i s:i s:i s:i s:s% s:i s:i s:F s:i s:s%}", "phrase", &s1, &l1,
-      "temperature", &observation->temperature, "temperatureMaxSince7am",
-      &observation->temperature_max, "feelsLike", &observation->feels_like,
-      "humidity", &observation->humidity, "windDirCompass", &s2, &l2,
-      "windDirDegrees", &observation->wind_direction_degrees, "windSpeed",
-      &observation->wind_speed, "visibility", &observation->visibility,
-      "uvIndex", &observation->uv_index, "uvDescription", &s3, &l3);
+      "temperature", &temperature, "temperatureMaxSince7am", &temperature_max,
+      "feelsLike", &feels_like, "humidity", &humidity, "windDirCompass", &s2,
+      &l2, "windDirDegrees", &wind_direction_degrees, "windSpeed", &wind_speed,
+      "visibility", &visibility, "uvIndex", &uv_index, "uvDescription", &s3,
+      &l3);
   if (rc != 0) {
-    json_decref(r);
+    arena_reset(&json_arena);
+    return -1;
+  }
+
+  observation->phrase = intern(s1, l1);
+  observation->temperature = CLAMP(temperature, -128, 127);
+  observation->temperature_max = CLAMP(temperature_max, -128, 127);
+  observation->feels_like = CLAMP(feels_like, -128, 127);
+  observation->humidity = CLAMP(humidity, 0, 100);
+  if ((wind_direction_compass = code(&compass_codes, s2, l2)) < 0 ||
+      (uv_description = code(&uv_description_codes, s3, l3)) < 0) {
+    arena_reset(&json_arena);
     return -1;
   }
 
-  strncpy(observation->phrase, s1, l1);
-  strncpy(observation->wind_direction_compass, s2, l2);
-  strncpy(observation->uv_description, s3, l3);
+  observation->wind_direction_compass = wind_direction_compass;
+  observation->wind_direction_degrees = CLAMP(wind_direction_degrees, 0, 360);
+  observation->wind_speed = CLAMP(wind_speed, 0, 255);
+  observation->visibility = visibility;
+  observation->uv_index = CLAMP(uv_index, 0, 255);
+  observation->uv_description = uv_description;
 
   observation->ready = 1;
 
-  json_decref(r);
+  arena_reset(&json_arena);
 
   return 0;
 }
 
+// the numbers that get looked at the most are kept in small per-part arrays
+// in forecast_s, so that going over all 14 days only touches a couple of
+// cache lines. Everything else lives in forecast_day_s. Text is copied into a
+// buffer owned by the forecast and referred to by offset, with 0 being "".
+// valid is only set for days and parts that the response actually had.
 struct forecast_part_s {
-  int valid;
-  char day_part_name[20];
-  int precip;
-  double precip_amount;
-  char precip_type[20];
-  int temperature;
-  int uv_index;
-  char uv_description[20];
-  int icon;
-  int icon_extended;
-  char phrase[30];
-  char narrative[150];
-  int cloud;
-  char wind_direction_compass[5];
-  int wind_direction_degrees;
-  int wind_speed;
-  int humidity;
-  char qualifier[10];
-  char snow_range[10];
-  int thunder_enum;
-  char thunder_enum_phrase[20];
+  unsigned char valid;
+  signed char temperature;
+  unsigned char precip, cloud, humidity, uv_index, wind_speed, icon;
+  unsigned char wind_direction_compass;
+};
+
+struct forecast_detail_s {
+  float precip_amount;
+  unsigned short icon_extended, wind_direction_degrees;
+  unsigned char thunder_enum;
+  unsigned char precip_type, uv_description, thunder_enum_phrase;
+  // qualifier is a free-form sentence ("Chance of frost"), so unlike the
+  // label for thunderEnum it has to live in the text buffer.
+  unsigned short day_part_name, phrase, narrative, snow_range, qualifier;
 };
 
 struct forecast_day_s {
-  struct tm valid_date, sunrise, sunset, moonrise, moonset;
-  char moon_icon[5], moon_phrase[20], weekday[10];
-  int snow_qpf;
+  time_t valid_date, sunrise, sunset, moonrise, moonset;
+  int utc_offset;
+  unsigned char valid;
+  unsigned short moon_icon, moon_phrase, weekday;
 
-  struct forecast_part_s day;
-  struct forecast_part_s night;
+  struct forecast_detail_s day_detail;
+  struct forecast_detail_s night_detail;
 };
 
 struct forecast_s {
-  char id[20];
+  struct forecast_part_s day[14];
+  struct forecast_part_s night[14];
   struct forecast_day_s days[14];
+
+  char *text;
+  size_t text_len, text_cap;
 };
 
-#define READ_FORECAST_DAY_S_STRING(O, JN, FN)              \
-  e = json_object_get(O, JN);                              \
-  if (!e || !json_is_array(e)) {                           \
-    fprintf(stderr, JN " was not an array\n");             \
-    json_decref(r);                                        \
-    return -1;                                             \
-  }                                                        \
-                                                           \
-  n = json_array_size(e);                                  \
-                                                           \
-  for (i = 0; i < MIN(n, 14); i++) {                       \
-    if ((v = json_array_get(e, i)) && json_is_string(v)) { \
-      strncpy(forecast->days[i].FN, json_string_value(v),  \
-              sizeof(forecast->days[i].FN));               \
-    }                                                      \
+// clears everything but keeps the text buffer around for the next parse, so
+// a warm forecast doesn't need to allocate.
+void forecast_clear(struct forecast_s *forecast) {
+  char *text;
+  size_t text_cap;
+
+  text = forecast->text;
+  text_cap = forecast->text_cap;
+
+  memset(forecast, 0, sizeof(struct forecast_s));
+
+  forecast->text = text;
+  forecast->text_cap = text_cap;
+  forecast->text_len = 1;
+}
+
+// returns an offset into the forecast's text, or -1 if it can't be stored.
+int forecast_text_add(struct forecast_s *forecast, const char *s, size_t l) {
+  size_t o, cap;
+  char *d;
+
+  if (l == 0) {
+    return 0;
   }
 
-#define READ_FORECAST_DAY_S_NUMBER(O, JN, FN)              \
+  if (forecast->text_len + l + 1 > FORECAST_TEXT_MAX) {
+    fprintf(stderr, "forecast text is over %d bytes\n", FORECAST_TEXT_MAX);
+    return -1;
+  }
+
+  if (forecast->text_len + l + 1 > forecast->text_cap) {
+    cap = MAX(forecast->text_cap * 2, FORECAST_TEXT_MIN);
+    while (cap < forecast->text_len + l + 1) {
+      cap *= 2;
+    }
+
+    if ((d = counted_realloc(forecast->text, cap)) == NULL) {
+      perror("realloc()");
+      return -1;
+    }
+
+    d[0] = '\0';
+
+    forecast->text = d;
+    forecast->text_cap = cap;
+  }
+
+  o = forecast->text_len;
+  memcpy(&(forecast->text[o]), s, l);
+  forecast->text[o + l] = '\0';
+  forecast->text_len += l + 1;
+
+  return o;
+}
+
+const char *forecast_text(struct forecast_s *forecast, unsigned short o) {
+  return forecast->text != NULL ? &(forecast->text[o]) : "";
+}
+
+// each of these marks the index of every value it actually finds in present,
+// so that parse_forecast can tell a real day or part from a run of nulls.
+#define READ_FORECAST_NUMBER(O, JN, FN, LO, HI)            \
   e = json_object_get(O, JN);                              \
   if (!e || !json_is_array(e)) {                           \
     fprintf(stderr, JN " was not an array\n");             \
-    json_decref(r);                                        \
+    arena_reset(&json_arena);                              \
     return -1;                                             \
   }                                                        \
                                                            \
@@ -312,141 +690,901 @@ struct forecast_s {
                                                            \
   for (i = 0; i < MIN(n, 14); i++) {                       \
     if ((v = json_array_get(e, i)) && json_is_number(v)) { \
-      forecast->days[i].FN = json_number_value(v);         \
+      d = json_number_value(v);                            \
+      forecast->FN = CLAMP(d, LO, HI);                     \
+      present[i] = 1;                                      \
     }                                                      \
   }
 
-#define READ_FORECAST_DAY_S_TIME(O, JN, FN)                 \
-  e = json_object_get(O, JN);                               \
-  if (!e || !json_is_array(e)) {                            \
-    fprintf(stderr, JN " was not an array\n");              \
-    json_decref(r);                                         \
-    return -1;                                              \
-  }                                                         \
-                                                            \
-  n = json_array_size(e);                                   \
-                                                            \
-  for (i = 0; i < MIN(n, 14); i++) {                        \
-    if ((v = json_array_get(e, i)) && json_is_string(v)) {  \
-      strptime(json_string_value(v), "%Y-%m-%dT%H:%M:%S%z", \
-               &forecast->days[i].FN);                      \
-      mktime(&forecast->days[i].FN);                        \
-    }                                                       \
+#define READ_FORECAST_TEXT(O, JN, FN)                        \
+  e = json_object_get(O, JN);                                \
+  if (!e || !json_is_array(e)) {                             \
+    fprintf(stderr, JN " was not an array\n");               \
+    arena_reset(&json_arena);                                \
+    return -1;                                               \
+  }                                                          \
+                                                             \
+  n = json_array_size(e);                                    \
+                                                             \
+  for (i = 0; i < MIN(n, 14); i++) {                         \
+    if ((v = json_array_get(e, i)) && json_is_string(v)) {   \
+      rc = forecast_text_add(forecast, json_string_value(v), \
+                             json_string_length(v));         \
+      if (rc < 0) {                                          \
+        arena_reset(&json_arena);                            \
+        return -1;                                           \
+      }                                                      \
+                                                             \
+      forecast->FN = rc;                                     \
+      present[i] = 1;                                        \
+    }                                                        \
   }
 
-int fetch_forecast(const char location[], struct forecast_s *forecast) {
-  int i, rc, n;
-  struct buf_s b;
-  char url[250], data[1024 * 100];
-  json_t *r, *o, *e, *v;
-  json_error_t err;
-
-  memset(url, 0, sizeof(url));
-  memset(data, 0, sizeof(data));
+#define READ_FORECAST_CODE(O, JN, FN, C)                          \
+  e = json_object_get(O, JN);                                     \
+  if (!e || !json_is_array(e)) {                                  \
+    fprintf(stderr, JN " was not an array\n");                    \
+    arena_reset(&json_arena);                                     \
+    return -1;                                                    \
+  }                                                               \
+                                                                  \
+  n = json_array_size(e);                                         \
+                                                                  \
+  for (i = 0; i < MIN(n, 14); i++) {                              \
+    if ((v = json_array_get(e, i)) && json_is_string(v)) {        \
+      rc = code(&C, json_string_value(v), json_string_length(v)); \
+      if (rc < 0) {                                               \
+        arena_reset(&json_arena);                                 \
+        return -1;                                                \
+      }                                                           \
+                                                                  \
+      forecast->FN = rc;                                          \
+      present[i] = 1;                                             \
+    }                                                             \
+  }
 
-  b.cap = 1024 * 100;
-  b.len = 0;
-  b.data = data;
+#define READ_FORECAST_TIME(O, JN, FN, OFN)                              \
+  e = json_object_get(O, JN);                                           \
+  if (!e || !json_is_array(e)) {                                        \
+    fprintf(stderr, JN " was not an array\n");                          \
+    arena_reset(&json_arena);                                           \
+    return -1;                                                          \
+  }                                                                     \
+                                                                        \
+  n = json_array_size(e);                                               \
+                                                                        \
+  for (i = 0; i < MIN(n, 14); i++) {                                    \
+    if ((v = json_array_get(e, i)) && json_is_string(v)) {              \
+      if (parse_time(json_string_value(v), &forecast->FN, &OFN) != 0) { \
+        fprintf(stderr, JN " had a malformed time\n");                  \
+        arena_reset(&json_arena);                                       \
+        return -1;                                                      \
+      }                                                                 \
+                                                                        \
+      present[i] = 1;                                                   \
+    }                                                                   \
+  }
 
-  sprintf(url,
-          "https://api.weather.com/v2/turbo/"
-          "vt1dailyForecast?apiKey=d522aa97197fd864d36b418f39ebb323&geocode=%s&"
-          "units=m&language=en-AU&format=json",
-          location);
+#define FORECAST_URL                                                     \
+  "https://api.weather.com/v2/turbo/"                                    \
+  "vt1dailyForecast?apiKey=d522aa97197fd864d36b418f39ebb323&geocode=%s&" \
+  "units=m&language=en-AU&format=json"
 
-  if ((rc = fetch_json(url, &b)) != 0) {
-    return rc;
-  }
+int parse_forecast(const char *data, size_t len, struct forecast_s *forecast) {
+  int i, n, rc, offset;
+  unsigned char present[14];
+  double d;
+  json_t *r, *o, *e, *v;
+  json_error_t err;
 
-  r = json_loads(b.data, 0, &err);
+  r = json_loadb(data, len, 0, &err);
 
   if (!r || !json_is_object(r)) {
     fprintf(stderr, "payload was not an object\n");
-    json_decref(r);
+    arena_reset(&json_arena);
     return -1;
   }
 
   o = json_object_get(r, "vt1dailyForecast");
   if (!o || !json_is_object(o)) {
     fprintf(stderr, "vt1dailyForecast was not an object\n");
-    json_decref(r);
+    arena_reset(&json_arena);
     return -1;
   }
 
-  memset(forecast, 0, sizeof(struct forecast_s));
+  forecast_clear(forecast);
+
+  // each day is shown in the offset its validDate was given in; the other
+  // times can be on the far side of a daylight saving change, so their
+  // offsets are thrown away
+  memset(present, 0, sizeof(present));
+  READ_FORECAST_TIME(o, "validDate", days[i].valid_date,
+                     forecast->days[i].utc_offset)
+  for (i = 0; i < 14; i++) {
+    forecast->days[i].valid = present[i];
+  }
 
-  READ_FORECAST_DAY_S_TIME(o, "validDate", valid_date)
-  READ_FORECAST_DAY_S_STRING(o, "dayOfWeek", weekday)
-  READ_FORECAST_DAY_S_TIME(o, "sunrise", sunrise)
-  READ_FORECAST_DAY_S_TIME(o, "sunset", sunset)
-  READ_FORECAST_DAY_S_STRING(o, "moonIcon", moon_icon)
-  READ_FORECAST_DAY_S_STRING(o, "moonPhrase", moon_phrase)
-  READ_FORECAST_DAY_S_TIME(o, "moonrise", moonrise)
-  READ_FORECAST_DAY_S_TIME(o, "moonset", moonset)
+  READ_FORECAST_TEXT(o, "dayOfWeek", days[i].weekday)
+  READ_FORECAST_TIME(o, "sunrise", days[i].sunrise, offset)
+  READ_FORECAST_TIME(o, "sunset", days[i].sunset, offset)
+  READ_FORECAST_TEXT(o, "moonIcon", days[i].moon_icon)
+  READ_FORECAST_TEXT(o, "moonPhrase", days[i].moon_phrase)
+  READ_FORECAST_TIME(o, "moonrise", days[i].moonrise, offset)
+  READ_FORECAST_TIME(o, "moonset", days[i].moonset, offset)
 
   o = json_object_get(json_object_get(r, "vt1dailyForecast"), "day");
   if (!o || !json_is_object(o)) {
     fprintf(stderr, "vt1dailyForecast.day was not an object\n");
-    json_decref(r);
+    arena_reset(&json_arena);
     return -1;
   }
 
-  READ_FORECAST_DAY_S_STRING(o, "dayPartName", day.day_part_name)
-  READ_FORECAST_DAY_S_NUMBER(o, "precipPct", day.precip)
-  READ_FORECAST_DAY_S_NUMBER(o, "precipAmt", day.precip_amount)
-  READ_FORECAST_DAY_S_STRING(o, "precipType", day.precip_type)
-  READ_FORECAST_DAY_S_NUMBER(o, "temperature", day.temperature);
-  READ_FORECAST_DAY_S_NUMBER(o, "uvIndex", day.uv_index);
-  READ_FORECAST_DAY_S_STRING(o, "uvDescription", day.uv_description)
-  READ_FORECAST_DAY_S_NUMBER(o, "icon", day.icon);
-  READ_FORECAST_DAY_S_NUMBER(o, "iconExtended", day.icon_extended);
-  READ_FORECAST_DAY_S_STRING(o, "phrase", day.phrase)
-  READ_FORECAST_DAY_S_STRING(o, "narrative", day.narrative)
-  READ_FORECAST_DAY_S_NUMBER(o, "cloudPct", day.cloud);
-  READ_FORECAST_DAY_S_STRING(o, "windDirCompass", day.wind_direction_compass)
-  READ_FORECAST_DAY_S_NUMBER(o, "windDirDegrees", day.wind_direction_degrees);
-  READ_FORECAST_DAY_S_NUMBER(o, "windSpeed", day.wind_speed);
-  READ_FORECAST_DAY_S_NUMBER(o, "humidityPct", day.humidity);
-  READ_FORECAST_DAY_S_STRING(o, "qualifier", day.qualifier)
-  READ_FORECAST_DAY_S_STRING(o, "snowRange", day.snow_range)
-  READ_FORECAST_DAY_S_NUMBER(o, "thunderEnum", day.thunder_enum);
-  READ_FORECAST_DAY_S_STRING(o, "thunderEnumPhrase", day.thunder_enum_phrase)
+  memset(present, 0, sizeof(present));
+  READ_FORECAST_TEXT(o, "dayPartName", days[i].day_detail.day_part_name)
+  READ_FORECAST_NUMBER(o, "precipPct", day[i].precip, 0, 100)
+  READ_FORECAST_NUMBER(o, "precipAmt", days[i].day_detail.precip_amount,
+                       0, 10000)
+  READ_FORECAST_CODE(o, "precipType", days[i].day_detail.precip_type,
+                     precip_type_codes)
+  READ_FORECAST_NUMBER(o, "temperature", day[i].temperature, -128, 127)
+  READ_FORECAST_NUMBER(o, "uvIndex", day[i].uv_index, 0, 255)
+  READ_FORECAST_CODE(o, "uvDescription", days[i].day_detail.uv_description,
+                     uv_description_codes)
+  READ_FORECAST_NUMBER(o, "icon", day[i].icon, 0, 255)
+  READ_FORECAST_NUMBER(o, "iconExtended", days[i].day_detail.icon_extended,
+                       0, 65535)
+  READ_FORECAST_TEXT(o, "phrase", days[i].day_detail.phrase)
+  READ_FORECAST_TEXT(o, "narrative", days[i].day_detail.narrative)
+  READ_FORECAST_NUMBER(o, "cloudPct", day[i].cloud, 0, 100)
+  READ_FORECAST_CODE(o, "windDirCompass", day[i].wind_direction_compass,
+                     compass_codes)
+  READ_FORECAST_NUMBER(o, "windDirDegrees",
+                       days[i].day_detail.wind_direction_degrees, 0, 360)
+  READ_FORECAST_NUMBER(o, "windSpeed", day[i].wind_speed, 0, 255)
+  READ_FORECAST_NUMBER(o, "humidityPct", day[i].humidity, 0, 100)
+  READ_FORECAST_TEXT(o, "qualifier", days[i].day_detail.qualifier)
+  READ_FORECAST_TEXT(o, "snowRange", days[i].day_detail.snow_range)
+  READ_FORECAST_NUMBER(o, "thunderEnum", days[i].day_detail.thunder_enum,
+                       0, 255)
+  READ_FORECAST_CODE(o, "thunderEnumPhrase",
+                     days[i].day_detail.thunder_enum_phrase,
+                     thunder_enum_phrase_codes)
+  for (i = 0; i < 14; i++) {
+    forecast->day[i].valid = forecast->days[i].valid && present[i];
+  }
 
   o = json_object_get(json_object_get(r, "vt1dailyForecast"), "night");
   if (!o || !json_is_object(o)) {
     fprintf(stderr, "vt1dailyForecast.night was not an object\n");
-    json_decref(r);
+    arena_reset(&json_arena);
     return -1;
   }
 
-  READ_FORECAST_DAY_S_STRING(o, "dayPartName", night.day_part_name)
-  READ_FORECAST_DAY_S_NUMBER(o, "precipPct", night.precip)
-  READ_FORECAST_DAY_S_NUMBER(o, "precipAmt", night.precip_amount)
-  READ_FORECAST_DAY_S_STRING(o, "precipType", night.precip_type)
-  READ_FORECAST_DAY_S_NUMBER(o, "temperature", night.temperature);
-  READ_FORECAST_DAY_S_NUMBER(o, "uvIndex", night.uv_index);
-  READ_FORECAST_DAY_S_STRING(o, "uvDescription", night.uv_description)
-  READ_FORECAST_DAY_S_NUMBER(o, "icon", night.icon);
-  READ_FORECAST_DAY_S_NUMBER(o, "iconExtended", night.icon_extended);
-  READ_FORECAST_DAY_S_STRING(o, "phrase", night.phrase)
-  READ_FORECAST_DAY_S_STRING(o, "narrative", night.narrative)
-  READ_FORECAST_DAY_S_NUMBER(o, "cloudPct", night.cloud);
-  READ_FORECAST_DAY_S_STRING(o, "windDirCompass", night.wind_direction_compass)
-  READ_FORECAST_DAY_S_NUMBER(o, "windDirDegrees", night.wind_direction_degrees);
-  READ_FORECAST_DAY_S_NUMBER(o, "windSpeed", night.wind_speed);
-  READ_FORECAST_DAY_S_NUMBER(o, "humidityPct", night.humidity);
-  READ_FORECAST_DAY_S_STRING(o, "qualifier", night.qualifier)
-  READ_FORECAST_DAY_S_STRING(o, "snowRange", night.snow_range)
-  READ_FORECAST_DAY_S_NUMBER(o, "thunderEnum", night.thunder_enum);
-  READ_FORECAST_DAY_S_STRING(o, "thunderEnumPhrase", night.thunder_enum_phrase)
-
-  json_decref(r);
+  memset(present, 0, sizeof(present));
+  READ_FORECAST_TEXT(o, "dayPartName", days[i].night_detail.day_part_name)
+  READ_FORECAST_NUMBER(o, "precipPct", night[i].precip, 0, 100)
+  READ_FORECAST_NUMBER(o, "precipAmt", days[i].night_detail.precip_amount,
+                       0, 10000)
+  READ_FORECAST_CODE(o, "precipType", days[i].night_detail.precip_type,
+                     precip_type_codes)
+  READ_FORECAST_NUMBER(o, "temperature", night[i].temperature, -128, 127)
+  READ_FORECAST_NUMBER(o, "uvIndex", night[i].uv_index, 0, 255)
+  READ_FORECAST_CODE(o, "uvDescription", days[i].night_detail.uv_description,
+                     uv_description_codes)
+  READ_FORECAST_NUMBER(o, "icon", night[i].icon, 0, 255)
+  READ_FORECAST_NUMBER(o, "iconExtended", days[i].night_detail.icon_extended,
+                       0, 65535)
+  READ_FORECAST_TEXT(o, "phrase", days[i].night_detail.phrase)
+  READ_FORECAST_TEXT(o, "narrative", days[i].night_detail.narrative)
+  READ_FORECAST_NUMBER(o, "cloudPct", night[i].cloud, 0, 100)
+  READ_FORECAST_CODE(o, "windDirCompass", night[i].wind_direction_compass,
+                     compass_codes)
+  READ_FORECAST_NUMBER(o, "windDirDegrees",
+                       days[i].night_detail.wind_direction_degrees, 0, 360)
+  READ_FORECAST_NUMBER(o, "windSpeed", night[i].wind_speed, 0, 255)
+  READ_FORECAST_NUMBER(o, "humidityPct", night[i].humidity, 0, 100)
+  READ_FORECAST_TEXT(o, "qualifier", days[i].night_detail.qualifier)
+  READ_FORECAST_TEXT(o, "snowRange", days[i].night_detail.snow_range)
+  READ_FORECAST_NUMBER(o, "thunderEnum", days[i].night_detail.thunder_enum,
+                       0, 255)
+  READ_FORECAST_CODE(o, "thunderEnumPhrase",
+                     days[i].night_detail.thunder_enum_phrase,
+                     thunder_enum_phrase_codes)
+  for (i = 0; i < 14; i++) {
+    forecast->night[i].valid = forecast->days[i].valid && present[i];
+  }
+
+  arena_reset(&json_arena);
+
+  return 0;
+}
+
+int fetch_forecast(const char location[], struct forecast_s *forecast) {
+  int rc;
+  struct buf_s b;
+  char url[250], data[1024 * 100];
+
+  memset(url, 0, sizeof(url));
+  memset(data, 0, sizeof(data));
+
+  b.cap = 1024 * 100;
+  b.len = 0;
+  b.data = data;
+
+  sprintf(url, FORECAST_URL, location);
+
+  if ((rc = fetch_json(url, &b)) != 0) {
+    return rc;
+  }
+
+  return parse_forecast(b.data, b.len, forecast);
+}
+
+// hourly data is only fetched once someone opens a day, and is bucketed by
+// the date it falls on so that it can be shown next to the daily forecast.
+// MAX_HOURS leaves room for the extra hour when daylight saving ends.
+struct forecast_hour_s {
+  unsigned char hour;
+  signed char temperature, feels_like;
+  unsigned char precip, humidity, cloud, wind_speed, uv_index;
+  unsigned char wind_direction_compass;
+  const char *phrase;
+};
+
+struct forecast_hours_s {
+  time_t fetched;
+  long date;
+  int count;
+  struct forecast_hour_s hours[MAX_HOURS];
+};
+
+struct hourly_s {
+  time_t attempted;
+  int busy;
+  CURLM *m;
+  CURL *ch;
+  struct buf_s buf;
+  char data[HOURLY_BUFFER];
+  struct forecast_hours_s days[14];
+};
+
+long forecast_day_number(struct forecast_s *forecast, int i) {
+  return day_number(forecast->days[i].valid_date, forecast->days[i].utc_offset);
+}
+
+int hourly_stale(struct hourly_s *hourly, struct forecast_s *forecast, int i) {
+  return time(NULL) - hourly->days[i].fetched >= HOURLY_TTL ||
+         hourly->days[i].date != forecast_day_number(forecast, i);
+}
+
+int json_array_int(json_t *a, size_t i, int lo, int hi) {
+  json_t *v;
+  double d;
+
+  if ((v = json_array_get(a, i)) && json_is_number(v)) {
+    d = json_number_value(v);
+    return CLAMP(d, lo, hi);
+  }
+
+  return 0;
+}
+
+const char *json_array_intern(json_t *a, size_t i) {
+  json_t *v;
+
+  if ((v = json_array_get(a, i)) && json_is_string(v)) {
+    return intern(json_string_value(v), json_string_length(v));
+  }
+
+  return intern("", 0);
+}
+
+int json_array_code(json_t *a, size_t i, struct codes_s *c) {
+  json_t *v;
+
+  if ((v = json_array_get(a, i)) && json_is_string(v)) {
+    return code(c, json_string_value(v), json_string_length(v));
+  }
 
   return 0;
 }
 
+// a single request covers every day that has hourly data, so opening one day
+// fills in its neighbours as well.
+int parse_hourly(const char *data, size_t len, struct forecast_s *forecast,
+                 struct hourly_s *hourly) {
+  int i, d, n, rc, offset;
+  long key;
+  json_t *r, *o, *times, *temperature, *feels_like, *precip, *humidity, *cloud,
+      *wind_speed, *wind_direction_compass, *uv_index, *phrase, *v;
+  json_error_t err;
+  struct forecast_hours_s *day;
+  struct forecast_hour_s *h;
+  time_t now, t;
+
+  r = json_loadb(data, len, 0, &err);
+
+  o = json_object_get(r, "vt1hourlyForecast");
+  if (!o || !json_is_object(o)) {
+    arena_reset(&json_arena);
+    return -1;
+  }
+
+  times = json_object_get(o, "processTime");
+  if (!times || !json_is_array(times)) {
+    arena_reset(&json_arena);
+    return -1;
+  }
+
+  temperature = json_object_get(o, "temperature");
+  feels_like = json_object_get(o, "feelsLike");
+  precip = json_object_get(o, "precipPct");
+  humidity = json_object_get(o, "humidity");
+  cloud = json_object_get(o, "cloudPct");
+  wind_speed = json_object_get(o, "windSpeed");
+  wind_direction_compass = json_object_get(o, "windDirCompass");
+  uv_index = json_object_get(o, "uvIndex");
+  phrase = json_object_get(o, "phrase");
+
+  now = time(NULL);
+
+  for (d = 0; d < 14; d++) {
+    hourly->days[d].fetched = now;
+    hourly->days[d].date = forecast_day_number(forecast, d);
+    hourly->days[d].count = 0;
+  }
+
+  n = json_array_size(times);
+
+  for (i = 0; i < n; i++) {
+    if (!(v = json_array_get(times, i)) || !json_is_string(v)) {
+      continue;
+    }
+
+    if (parse_time(json_string_value(v), &t, &offset) != 0) {
+      continue;
+    }
+
+    key = day_number(t, offset);
+    for (d = 0; d < 14 && hourly->days[d].date != key; d++) {
+    }
+    if (d == 14 || hourly->days[d].count == MAX_HOURS) {
+      continue;
+    }
+
+    day = &hourly->days[d];
+    h = &day->hours[day->count++];
+
+    h->hour = (t + offset) % 86400 / 3600;
+    h->temperature = json_array_int(temperature, i, -128, 127);
+    h->feels_like = json_array_int(feels_like, i, -128, 127);
+    h->precip = json_array_int(precip, i, 0, 100);
+    h->humidity = json_array_int(humidity, i, 0, 100);
+    h->cloud = json_array_int(cloud, i, 0, 100);
+    h->wind_speed = json_array_int(wind_speed, i, 0, 255);
+    h->uv_index = json_array_int(uv_index, i, 0, 255);
+    h->phrase = json_array_intern(phrase, i);
+
+    if ((rc = json_array_code(wind_direction_compass, i, &compass_codes)) < 0) {
+      // don't leave half a response looking like a good one
+      for (d = 0; d < 14; d++) {
+        hourly->days[d].fetched = 0;
+      }
+
+      arena_reset(&json_arena);
+      return -1;
+    }
+
+    h->wind_direction_compass = rc;
+  }
+
+  arena_reset(&json_arena);
+
+  return 0;
+}
+
+// the hourly forecast is fetched without blocking the UI. hourly_start kicks
+// off the transfer, and the main loop waits on its sockets alongside stdin and
+// calls hourly_poll to move it along.
+void hourly_start(const char location[], struct hourly_s *hourly) {
+  char url[250];
+
+  if (hourly->busy) {
+    return;
+  }
+
+  if (hourly->m == NULL) {
+    hourly->m = curl_multi_init();
+    hourly->ch = curl_easy_init();
+
+    hourly->buf.cap = HOURLY_BUFFER;
+    hourly->buf.data = hourly->data;
+
+    curl_easy_setopt(hourly->ch, CURLOPT_WRITEFUNCTION, buf_write_cb);
+    curl_easy_setopt(hourly->ch, CURLOPT_WRITEDATA, &hourly->buf);
+    curl_easy_setopt(hourly->ch, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(hourly->ch, CURLOPT_CONNECTTIMEOUT,
+                     (long)FETCH_CONNECT_TIMEOUT);
+    curl_easy_setopt(hourly->ch, CURLOPT_TIMEOUT, (long)FETCH_TIMEOUT);
+  }
+
+  snprintf(url, sizeof(url),
+           "https://api.weather.com/v2/turbo/"
+           "vt1hourlyForecast?apiKey=d522aa97197fd864d36b418f39ebb323&geocode="
+           "%s&units=m&language=en-AU&format=json",
+           location);
+
+  hourly->buf.len = 0;
+  hourly->attempted = time(NULL);
+  hourly->busy = 1;
+
+  curl_easy_setopt(hourly->ch, CURLOPT_URL, url);
+  curl_multi_add_handle(hourly->m, hourly->ch);
+}
+
+// returns 1 once a transfer has finished, whether or not it worked.
+int hourly_poll(struct hourly_s *hourly, struct forecast_s *forecast) {
+  int running, queued, done;
+  long status;
+  CURLcode result;
+  CURLMsg *msg;
+
+  if (!hourly->busy) {
+    return 0;
+  }
+
+  curl_multi_perform(hourly->m, &running);
+
+  done = 0;
+
+  while ((msg = curl_multi_info_read(hourly->m, &queued)) != NULL) {
+    if (msg->msg != CURLMSG_DONE) {
+      continue;
+    }
+
+    result = msg->data.result;
+    status = 0;
+    curl_easy_getinfo(hourly->ch, CURLINFO_RESPONSE_CODE, &status);
+    curl_multi_remove_handle(hourly->m, hourly->ch);
+
+    if (result == CURLE_OK && status == 200) {
+      parse_hourly(hourly->buf.data, hourly->buf.len, forecast, hourly);
+    }
+
+    hourly->busy = 0;
+    done = 1;
+  }
+
+  return done;
+}
+
+// batch mode fetches the forecast for a long list of points without a
+// terminal. Points are read (or generated, for a grid) one at a time as slots
+// free up, and each result is written out as soon as it's parsed, so memory
+// use doesn't depend on how many points there are.
+enum batch_state_e { BATCH_IDLE, BATCH_WAITING, BATCH_RUNNING };
+
+struct batch_slot_s {
+  enum batch_state_e state;
+  CURL *ch;
+  int attempts;
+  double lat, lon, not_before;
+  struct buf_s buf;
+  char data[BATCH_BUFFER];
+};
+
+struct points_s {
+  FILE *f;
+  int grid;
+  double lat, lon, step;
+  long rows, cols, i;
+};
+
+struct bucket_s {
+  double tokens, rate, burst, last;
+};
+
+double now_seconds() {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int points_open(struct points_s *p, const char *list, const char *grid) {
+  double lat1, lon1, lat2, lon2;
+
+  memset(p, 0, sizeof(struct points_s));
+
+  if (grid != NULL) {
+    if (sscanf(grid, "%lf,%lf,%lf,%lf,%lf", &lat1, &lon1, &lat2, &lon2,
+               &p->step) != 5 ||
+        p->step <= 0) {
+      fprintf(stderr, "Error: grid must be lat1,lon1,lat2,lon2,step\n");
+      return -1;
+    }
+
+    p->grid = 1;
+    p->lat = MIN(lat1, lat2);
+    p->lon = MIN(lon1, lon2);
+    p->rows = (long)((MAX(lat1, lat2) - p->lat) / p->step + 1e-9) + 1;
+    p->cols = (long)((MAX(lon1, lon2) - p->lon) / p->step + 1e-9) + 1;
+
+    return 0;
+  }
+
+  if (strcmp(list, "-") == 0) {
+    p->f = stdin;
+  } else if ((p->f = fopen(list, "r")) == NULL) {
+    perror(list);
+    return -1;
+  }
+
+  return 0;
+}
+
+// returns 1 for a point, 0 at the end, or -1 for a line that isn't a point.
+int points_next(struct points_s *p, double *lat, double *lon) {
+  char line[100];
+
+  if (p->grid) {
+    if (p->i == p->rows * p->cols) {
+      return 0;
+    }
+
+    *lat = p->lat + (p->i / p->cols) * p->step;
+    *lon = p->lon + (p->i % p->cols) * p->step;
+    p->i++;
+
+    return 1;
+  }
+
+  while (fgets(line, sizeof(line), p->f) != NULL) {
+    p->i++;
+
+    if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+      continue;
+    }
+
+    if (sscanf(line, "%lf,%lf", lat, lon) == 2) {
+      return 1;
+    }
+
+    fprintf(stderr, "line %ld: expected lat,lon\n", p->i);
+    return -1;
+  }
+
+  return 0;
+}
+
+void points_close(struct points_s *p) {
+  if (p->f != NULL && p->f != stdin) {
+    fclose(p->f);
+  }
+}
+
+void bucket_init(struct bucket_s *b, double rate) {
+  b->rate = rate;
+  b->burst = MAX(rate, 1);
+  b->tokens = b->burst;
+  b->last = now_seconds();
+}
+
+int bucket_take(struct bucket_s *b) {
+  double now;
+
+  now = now_seconds();
+  b->tokens = MIN(b->burst, b->tokens + (now - b->last) * b->rate);
+  b->last = now;
+
+  if (b->tokens < 1) {
+    return 0;
+  }
+
+  b->tokens -= 1;
+
+  return 1;
+}
+
+void csv_string(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s != '\0'; s++) {
+    if (*s == '"') {
+      fputc('"', f);
+    }
+    fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+void write_forecast_csv_header(FILE *f) {
+  fputs(
+      "lat,lon,day,valid_date,part,day_part_name,precip,precip_amount,"
+      "precip_type,temperature,uv_index,uv_description,icon,icon_extended,"
+      "phrase,narrative,cloud,wind_direction_compass,wind_direction_degrees,"
+      "wind_speed,humidity,qualifier,snow_range,thunder_enum,"
+      "thunder_enum_phrase\n",
+      f);
+}
+
+void write_forecast_part_csv(FILE *f, double lat, double lon, int i,
+                             const char *date, const char *name,
+                             struct forecast_s *forecast,
+                             struct forecast_part_s *p,
+                             struct forecast_detail_s *d) {
+  fprintf(f, "%.4f,%.4f,%d,%s,%s,", lat, lon, i, date, name);
+  if (!p->valid) {
+    // one empty field for each column from day_part_name onwards
+    fputs(",,,,,,,,,,,,,,,,,,,\n", f);
+    return;
+  }
+
+  csv_string(f, forecast_text(forecast, d->day_part_name));
+  fprintf(f, ",%d,%.2f,", p->precip, d->precip_amount);
+  csv_string(f, precip_type_codes.names[d->precip_type]);
+  fprintf(f, ",%d,%d,", p->temperature, p->uv_index);
+  csv_string(f, uv_description_codes.names[d->uv_description]);
+  fprintf(f, ",%d,%d,", p->icon, d->icon_extended);
+  csv_string(f, forecast_text(forecast, d->phrase));
+  fputc(',', f);
+  csv_string(f, forecast_text(forecast, d->narrative));
+  fprintf(f, ",%d,", p->cloud);
+  csv_string(f, compass_codes.names[p->wind_direction_compass]);
+  fprintf(f, ",%d,%d,%d,", d->wind_direction_degrees, p->wind_speed,
+          p->humidity);
+  csv_string(f, forecast_text(forecast, d->qualifier));
+  fputc(',', f);
+  csv_string(f, forecast_text(forecast, d->snow_range));
+  fprintf(f, ",%d,", d->thunder_enum);
+  csv_string(f, thunder_enum_phrase_codes.names[d->thunder_enum_phrase]);
+  fputc('\n', f);
+}
+
+void write_forecast_csv(FILE *f, double lat, double lon,
+                        struct forecast_s *forecast) {
+  int i;
+  char date[20];
+  struct tm tm;
+
+  for (i = 0; i < 14; i++) {
+    if (!forecast->days[i].valid) {
+      continue;
+    }
+
+    location_time(forecast->days[i].valid_date, forecast->days[i].utc_offset,
+                  &tm);
+    strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+    write_forecast_part_csv(f, lat, lon, i, date, "day", forecast,
+                            &forecast->day[i], &forecast->days[i].day_detail);
+    write_forecast_part_csv(f, lat, lon, i, date, "night", forecast,
+                            &forecast->night[i],
+                            &forecast->days[i].night_detail);
+  }
+}
+
+// only failures that might go away by themselves are worth another try.
+int batch_retryable(CURLcode result, long status) {
+  switch (result) {
+    case CURLE_OK:
+      return status == 429 || status >= 500;
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_RESOLVE_PROXY:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+void batch_start(CURLM *m, struct batch_slot_s *s) {
+  char location[50], url[250];
+
+  snprintf(location, sizeof(location), "%.4f,%.4f", s->lat, s->lon);
+  snprintf(url, sizeof(url), FORECAST_URL, location);
+
+  s->buf.len = 0;
+  s->state = BATCH_RUNNING;
+
+  curl_easy_setopt(s->ch, CURLOPT_URL, url);
+  curl_multi_add_handle(m, s->ch);
+}
+
+int batch(const char *list, const char *grid, const char *output,
+          int concurrency, double rate) {
+  int i, active, running, queued, more, numfds;
+  long status;
+  CURLcode result;
+  unsigned long done, failed;
+  double started, reported, now;
+  struct timeval tv;
+  FILE *out;
+  CURLM *m;
+  CURLMsg *msg;
+  struct batch_slot_s *slots, *s;
+  struct points_s points;
+  struct bucket_s bucket;
+  struct forecast_s forecast;
+
+  if (points_open(&points, list, grid) != 0) {
+    return 1;
+  }
+
+  if (output == NULL || strcmp(output, "-") == 0) {
+    out = stdout;
+  } else if ((out = fopen(output, "w")) == NULL) {
+    perror(output);
+    points_close(&points);
+    return 1;
+  }
+
+  if ((slots = calloc(concurrency, sizeof(struct batch_slot_s))) == NULL) {
+    perror("calloc()");
+    points_close(&points);
+    return 1;
+  }
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  m = curl_multi_init();
+
+  for (i = 0; i < concurrency; i++) {
+    s = &slots[i];
+
+    s->buf.cap = BATCH_BUFFER;
+    s->buf.data = s->data;
+
+    s->ch = curl_easy_init();
+    curl_easy_setopt(s->ch, CURLOPT_WRITEFUNCTION, buf_write_cb);
+    curl_easy_setopt(s->ch, CURLOPT_WRITEDATA, &s->buf);
+    curl_easy_setopt(s->ch, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(s->ch, CURLOPT_PRIVATE, s);
+
+    // a stalled connection would otherwise hold on to its slot forever
+    curl_easy_setopt(s->ch, CURLOPT_CONNECTTIMEOUT,
+                     (long)FETCH_CONNECT_TIMEOUT);
+    curl_easy_setopt(s->ch, CURLOPT_TIMEOUT, (long)FETCH_TIMEOUT);
+    curl_easy_setopt(s->ch, CURLOPT_LOW_SPEED_LIMIT, (long)BATCH_LOW_SPEED);
+    curl_easy_setopt(s->ch, CURLOPT_LOW_SPEED_TIME, (long)BATCH_LOW_SPEED_TIME);
+  }
+
+  bucket_init(&bucket, rate);
+  memset(&forecast, 0, sizeof(forecast));
+
+  write_forecast_csv_header(out);
+
+  more = 1;
+  done = 0;
+  failed = 0;
+  started = reported = now_seconds();
+
+  while (1) {
+    now = now_seconds();
+    active = 0;
+
+    for (i = 0; i < concurrency; i++) {
+      s = &slots[i];
+
+      if (s->state == BATCH_IDLE && more) {
+        while ((more = points_next(&points, &s->lat, &s->lon)) < 0) {
+          failed++;
+        }
+
+        if (more) {
+          s->state = BATCH_WAITING;
+          s->attempts = 0;
+          s->not_before = 0;
+        }
+      }
+
+      if (s->state == BATCH_WAITING && s->not_before <= now &&
+          bucket_take(&bucket)) {
+        batch_start(m, s);
+      }
+
+      if (s->state != BATCH_IDLE) {
+        active++;
+      }
+    }
+
+    if (active == 0 && !more) {
+      break;
+    }
+
+    curl_multi_perform(m, &running);
+
+    while ((msg = curl_multi_info_read(m, &queued)) != NULL) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+
+      // msg doesn't survive curl_multi_remove_handle, so take what we need
+      result = msg->data.result;
+      status = 0;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&s);
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &status);
+      curl_multi_remove_handle(m, s->ch);
+
+      s->attempts++;
+
+      if (result == CURLE_OK && status == 200) {
+        if (parse_forecast(s->buf.data, s->buf.len, &forecast) == 0) {
+          write_forecast_csv(out, s->lat, s->lon, &forecast);
+          done++;
+        } else {
+          fprintf(stderr, "%.4f,%.4f: couldn't parse forecast\n", s->lat,
+                  s->lon);
+          failed++;
+        }
+
+        s->state = BATCH_IDLE;
+      } else if (!batch_retryable(result, status)) {
+        // the request itself is bad (a bad geocode, say, or a response too
+        // big for the buffer), so asking again won't help and would only use
+        // up rate limit tokens
+        if (result == CURLE_OK) {
+          fprintf(stderr, "%.4f,%.4f: HTTP %ld\n", s->lat, s->lon, status);
+        } else {
+          fprintf(stderr, "%.4f,%.4f: %s\n", s->lat, s->lon,
+                  curl_easy_strerror(result));
+        }
+
+        s->state = BATCH_IDLE;
+        failed++;
+      } else if (s->attempts > BATCH_RETRIES) {
+        fprintf(stderr, "%.4f,%.4f: giving up after %d attempts\n", s->lat,
+                s->lon, s->attempts);
+        s->state = BATCH_IDLE;
+        failed++;
+      } else {
+        s->state = BATCH_WAITING;
+        s->not_before = now_seconds() + 0.5 * (1 << s->attempts);
+      }
+    }
+
+    if ((now = now_seconds()) - reported >= 5) {
+      fprintf(stderr, "%lu points, %lu failed, %.1f points/s\n", done, failed,
+              done / (now - started));
+      reported = now;
+    }
+
+    // curl_multi_wait returns straight away if there's nothing in flight,
+    // which is the case while every slot is backing off
+    curl_multi_wait(m, NULL, 0, 10, &numfds);
+    if (numfds == 0) {
+      tv.tv_sec = 0;
+      tv.tv_usec = 10000;
+      select(0, NULL, NULL, NULL, &tv);
+    }
+  }
+
+  now = now_seconds();
+  fprintf(stderr, "%lu points, %lu failed, %.1f points/s\n", done, failed,
+          done / MAX(now - started, 0.001));
+
+  for (i = 0; i < concurrency; i++) {
+    curl_easy_cleanup(slots[i].ch);
+  }
+  curl_multi_cleanup(m);
+  curl_global_cleanup();
+
+  free(forecast.text);
+  free(slots);
+  points_close(&points);
+
+  if (out != stdout) {
+    fclose(out);
+  } else {
+    fflush(out);
+  }
+
+  return failed > 0 ? 1 : 0;
+}
+
 void update_current(WINDOW *w, struct observation_s *observation, int interval,
-                    time_t t) {
+                    time_t t, unsigned long allocs) {
   char str[65];
   struct tm lt;
   time_t n;
@@ -462,8 +1600,7 @@ void update_current(WINDOW *w, struct observation_s *observation, int interval,
     mvwaddstr(w, 1, 0, ICON_UNKNOWN);
 
     for (i = 0; icons[i].phrase != NULL; i++) {
-      if (strncmp(observation->phrase, icons[i].phrase,
-                  sizeof(observation->phrase)) == 0) {
+      if (strcmp(observation->phrase, icons[i].phrase) == 0) {
         if (lt.tm_hour > 5 && lt.tm_hour < 19) {
           mvwaddstr(w, 1, 0, icons[i].day);
         } else {
@@ -509,15 +1646,19 @@ void update_current(WINDOW *w, struct observation_s *observation, int interval,
     mvwaddstr(w, 14, 2, str);
 
     snprintf(str, sizeof(str), "     Wind: %d %s", observation->wind_speed,
-             observation->wind_direction_compass);
+             compass_codes.names[observation->wind_direction_compass]);
     mvwaddstr(w, 15, 2, str);
 
     snprintf(str, sizeof(str), "Visbility: %.2fkm", observation->visibility);
     mvwaddstr(w, 16, 2, str);
 
-    snprintf(str, sizeof(str), "  UV risk: %s", observation->uv_description);
+    snprintf(str, sizeof(str), "  UV risk: %s",
+             uv_description_codes.names[observation->uv_description]);
     mvwaddstr(w, 17, 2, str);
 
+    snprintf(str, sizeof(str), "   Allocs: %lu", allocs);
+    mvwaddstr(w, 18, 2, str);
+
     box(w, '|', '-');
     attron(COLOR_PAIR(2) | A_BOLD);
     mvwaddstr(w, 0, 2, "Current Conditions");
@@ -537,31 +1678,126 @@ void update_forecast(WINDOW *w) {
   wrefresh(w);
 }
 
-void update_forecast_day(WINDOW *w, struct forecast_s *forecast, int i) {
-  int x;
+void update_forecast_day(WINDOW *w, struct forecast_s *forecast, int i,
+                         int selected) {
+  int x, offset;
   char str[100], d[20], sunrise[15], sunset[15], moonrise[15], moonset[15];
+  struct tm tm;
 
   x = getmaxx(w);
+  offset = forecast->days[i].utc_offset;
 
   wclear(w);
 
   mvwhline(w, 0, 0, '-', x);
 
   attron(COLOR_PAIR(2) | A_BOLD);
-  strftime(d, 20, "%b %e, %A", &forecast->days[i].valid_date);
-  snprintf(str, sizeof(str), " %s, %s ", d, forecast->days[i].moon_phrase);
+  if (selected) {
+    wattron(w, A_REVERSE);
+  }
+  location_time(forecast->days[i].valid_date, offset, &tm);
+  strftime(d, 20, "%b %e, %A", &tm);
+  snprintf(str, sizeof(str), " %s, %s ", d,
+           forecast_text(forecast, forecast->days[i].moon_phrase));
   mvwaddstr(w, 0, 2, str);
+  wattroff(w, A_REVERSE);
   attroff(COLOR_PAIR(2) | A_BOLD);
 
-  strftime(sunrise, 15, "%R", &forecast->days[i].sunrise);
-  strftime(sunset, 15, "%R", &forecast->days[i].sunset);
-  strftime(moonrise, 15, "%R", &forecast->days[i].moonrise);
-  strftime(moonset, 15, "%R", &forecast->days[i].moonset);
+  location_time(forecast->days[i].sunrise, offset, &tm);
+  strftime(sunrise, 15, "%R", &tm);
+  location_time(forecast->days[i].sunset, offset, &tm);
+  strftime(sunset, 15, "%R", &tm);
+  location_time(forecast->days[i].moonrise, offset, &tm);
+  strftime(moonrise, 15, "%R", &tm);
+  location_time(forecast->days[i].moonset, offset, &tm);
+  strftime(moonset, 15, "%R", &tm);
   snprintf(str, sizeof(str), "Sun/moon: %s-%s, %s-%s", sunrise, sunset,
            moonrise, moonset);
   mvwaddstr(w, 1, 0, str);
 
-  mvwaddstr(w, 2, 0, forecast->days[i].day.narrative);
+  mvwaddstr(w, 2, 0,
+            forecast_text(forecast, forecast->days[i].day_detail.narrative));
+
+  wrefresh(w);
+}
+
+void update_hourly(WINDOW *w, struct forecast_s *forecast,
+                   struct hourly_s *hourly, int i, int *scroll) {
+  int x, y, j, row, current;
+  char str[100], d[20];
+  struct forecast_hours_s *day;
+  struct forecast_hour_s *h;
+  struct tm tm;
+
+  x = getmaxx(w);
+  y = getmaxy(w);
+  day = &hourly->days[i];
+
+  wclear(w);
+
+  mvwhline(w, 0, 1, '-', x - 2);
+
+  attron(COLOR_PAIR(2) | A_BOLD);
+  location_time(forecast->days[i].valid_date, forecast->days[i].utc_offset,
+                &tm);
+  strftime(d, 20, "%b %e, %A", &tm);
+  snprintf(str, sizeof(str), " %s, hourly ", d);
+  mvwaddstr(w, 0, 3, str);
+  attroff(COLOR_PAIR(2) | A_BOLD);
+
+  // status goes on its own row so that it isn't hidden by the hours below
+  current = day->fetched != 0 && day->date == forecast_day_number(forecast, i);
+
+  if (hourly->busy) {
+    mvwaddstr(w, 1, 1, "Updating...");
+  } else if (!current) {
+    mvwaddstr(w, 1, 1, "Hourly forecast unavailable");
+  } else if (hourly_stale(hourly, forecast, i)) {
+    mvwaddstr(w, 1, 1, "Hourly forecast out of date");
+  } else if (day->count == 0) {
+    mvwaddstr(w, 1, 1, "No hourly forecast for this day");
+  }
+
+  // the hours go between the status row and the footer. If they don't all
+  // fit they're scrolled through, with a line at either end saying how many
+  // are out of view.
+  if (!current || day->count <= y - 3) {
+    *scroll = 0;
+  } else {
+    *scroll = MIN(*scroll, day->count - MAX(y - 4, 1));
+    *scroll = MAX(*scroll, 0);
+  }
+
+  j = *scroll;
+  row = 2;
+
+  if (j > 0) {
+    snprintf(str, sizeof(str), "+%d earlier", j);
+    mvwaddnstr(w, row++, 1, str, x - 2);
+  }
+
+  for (; current && j < day->count && row < y - 1; j++, row++) {
+    if (row == y - 2 && j < day->count - 1) {
+      break;
+    }
+
+    h = &day->hours[j];
+
+    snprintf(str, sizeof(str),
+             "%02d:00 %4dc/%3dc %3d%% rain %3d%% hum %3d %-3s %s", h->hour,
+             h->temperature, h->feels_like, h->precip, h->humidity,
+             h->wind_speed, compass_codes.names[h->wind_direction_compass],
+             h->phrase);
+    mvwaddnstr(w, row, 1, str, x - 2);
+  }
+
+  if (current && j < day->count) {
+    snprintf(str, sizeof(str), "+%d more", day->count - j);
+    mvwaddnstr(w, row, 1, str, x - 2);
+  }
+
+  mvwaddnstr(w, y - 1, 1, "left/right: day, up/down: scroll, enter: close",
+             x - 2);
 
   wrefresh(w);
 }
@@ -575,8 +1811,15 @@ void usage() {
       "options:\n"
       "  -l <latitude,longitude> specify the location\n"
       "  -i <seconds> specify the interval for updates (default %d, minimum "
-      "%d)\n",
-      DEFAULT_INTERVAL, MINIMUM_INTERVAL);
+      "%d)\n"
+      "\n"
+      "batch options:\n"
+      "  -b <file> read lat,lon points from file, one per line (- for stdin)\n"
+      "  -g <lat1,lon1,lat2,lon2,step> fetch forecasts for a grid of points\n"
+      "  -o <file> write batch results as CSV to file (default stdout)\n"
+      "  -c <count> number of concurrent requests (default %d)\n"
+      "  -r <rate> maximum requests per second (default %d)\n",
+      DEFAULT_INTERVAL, MINIMUM_INTERVAL, DEFAULT_CONCURRENCY, DEFAULT_RATE);
 }
 
 int main(int argc, char **argv) {
@@ -590,17 +1833,40 @@ int main(int argc, char **argv) {
   int cfg_i;
   struct observation_s observation;
   struct forecast_s forecast;
+  struct hourly_s hourly;
+  int selected, expanded, scroll, redraw;
+  const char *list, *grid, *output;
+  int concurrency;
+  double rate;
   WINDOW *mw, *cw, *fw, *dw[14];
-  fd_set rfds;
+  fd_set rfds, wfds, efds;
+  int fd, maxfd;
   struct timeval tv;
   time_t t;
+  unsigned long allocs, allocs_before;
 
   memset(location, 0, sizeof(location));
   memset(&observation, 0, sizeof(observation));
+  observation.phrase = intern("", 0);
   memset(&forecast, 0, sizeof(forecast));
+  memset(&hourly, 0, sizeof(hourly));
 
   strncpy(location, DEFAULT_LOCATION, sizeof(location));
   interval = DEFAULT_INTERVAL;
+  allocs = 0;
+  list = NULL;
+  grid = NULL;
+  output = NULL;
+  concurrency = DEFAULT_CONCURRENCY;
+  rate = DEFAULT_RATE;
+  selected = 0;
+  expanded = 0;
+  scroll = 0;
+  redraw = 0;
+
+  json_set_alloc_funcs(arena_alloc, arena_free);
+  curl_global_init_mem(CURL_GLOBAL_DEFAULT, counted_malloc, counted_free,
+                       counted_realloc, counted_strdup, counted_calloc);
 
   memset(path, 0, sizeof(path));
 
@@ -633,7 +1899,7 @@ int main(int argc, char **argv) {
     interval = atoi(s);
   }
 
-  while ((c = getopt(argc, argv, "l:i:")) != -1) {
+  while ((c = getopt(argc, argv, "l:i:b:g:o:c:r:")) != -1) {
     switch (c) {
       case 'l':
         strncpy(location, optarg, sizeof(location));
@@ -641,6 +1907,21 @@ int main(int argc, char **argv) {
       case 'i':
         interval = atoi(optarg);
         break;
+      case 'b':
+        list = optarg;
+        break;
+      case 'g':
+        grid = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'c':
+        concurrency = atoi(optarg);
+        break;
+      case 'r':
+        rate = atof(optarg);
+        break;
       case '?':
         usage();
         exit(0);
@@ -652,6 +1933,22 @@ int main(int argc, char **argv) {
     }
   }
 
+  if (list != NULL || grid != NULL) {
+    if (concurrency < 1) {
+      printf("Error: concurrency must be at least 1\n\n");
+      usage();
+      exit(1);
+    }
+
+    if (rate <= 0) {
+      printf("Error: rate must be greater than 0\n\n");
+      usage();
+      exit(1);
+    }
+
+    return batch(list, grid, output, concurrency, rate);
+  }
+
   if (strlen(location) == 0) {
     printf("Error: location not specified\n\n");
     usage();
@@ -689,18 +1986,34 @@ int main(int argc, char **argv) {
   while (1) {
     if (t != 0) {
       FD_ZERO(&rfds);
+      FD_ZERO(&wfds);
+      FD_ZERO(&efds);
       FD_SET(0, &rfds);
+      maxfd = 0;
 
       tv.tv_sec = 0;
       tv.tv_usec = 500000;
 
-      rc = select(1, &rfds, NULL, NULL, &tv);
+      if (hourly.busy) {
+        curl_multi_fdset(hourly.m, &rfds, &wfds, &efds, &fd);
+        maxfd = MAX(maxfd, fd);
+
+        // curl doesn't always have a socket to offer (while resolving, for
+        // example), so come back soon either way
+        tv.tv_usec = 50000;
+      }
+
+      rc = select(maxfd + 1, &rfds, &wfds, &efds, &tv);
       if (rc == -1) {
         perror("select()");
         break;
       }
 
-      if (rc) {
+      if (hourly_poll(&hourly, &forecast)) {
+        redraw = 1;
+      }
+
+      if (FD_ISSET(0, &rfds)) {
         switch ((c = wgetch(stdscr))) {
           case 'q':
             endwin();
@@ -708,30 +2021,100 @@ int main(int argc, char **argv) {
           case 'u':
             t = 0;
             break;
+          case KEY_UP:
+          case 'k':
+            if (expanded) {
+              scroll--;
+              redraw = 1;
+              break;
+            }
+            // fall through
+          case KEY_LEFT:
+          case 'h':
+            if (selected > 0) {
+              selected--;
+              scroll = 0;
+              redraw = 1;
+            }
+            break;
+          case KEY_DOWN:
+          case 'j':
+            if (expanded) {
+              scroll++;
+              redraw = 1;
+              break;
+            }
+            // fall through
+          case KEY_RIGHT:
+          case 'l':
+            if (selected < 13) {
+              selected++;
+              scroll = 0;
+              redraw = 1;
+            }
+            break;
+          case '\n':
+          case KEY_ENTER:
+            expanded = !expanded;
+            scroll = 0;
+            redraw = 1;
+            break;
+        }
+
+        if (redraw && expanded && hourly_stale(&hourly, &forecast, selected)) {
+          hourly_start(location, &hourly);
         }
+      } else if (expanded && !hourly.busy &&
+                 time(NULL) - hourly.attempted >= MINIMUM_INTERVAL &&
+                 ((selected > 0 &&
+                   hourly_stale(&hourly, &forecast, selected - 1)) ||
+                  (selected < 13 &&
+                   hourly_stale(&hourly, &forecast, selected + 1)))) {
+        // nobody's pressing anything, so refresh the neighbouring days now
+        // rather than making them wait for it when they move over
+        hourly_start(location, &hourly);
+        redraw = 1;
       }
     }
 
     if ((time(NULL) - t) >= interval) {
-      update_current(cw, &observation, interval, 0);
+      update_current(cw, &observation, interval, 0, allocs);
+
+      allocs_before = heap_allocs;
 
       if ((rc = fetch_observation(location, &observation)) != 0) {
-        update_current(cw, &observation, interval, -1);
+        update_current(cw, &observation, interval, -1, allocs);
       }
 
       if ((rc = fetch_forecast(location, &forecast)) != 0) {
-        update_current(cw, &observation, interval, -1);
+        update_current(cw, &observation, interval, -1, allocs);
+      }
+
+      if (expanded && hourly_stale(&hourly, &forecast, selected)) {
+        hourly_start(location, &hourly);
       }
 
+      allocs = heap_allocs - allocs_before;
+
       t = time(NULL);
 
-      update_current(cw, &observation, interval, t);
+      update_current(cw, &observation, interval, t, allocs);
+      redraw = 1;
+    } else {
+      update_current(cw, &observation, interval, t, allocs);
+    }
+
+    if (redraw) {
       update_forecast(fw);
-      for (i = 0; i < 14; i++) {
-        update_forecast_day(dw[i], &forecast, i);
+      if (expanded) {
+        update_hourly(fw, &forecast, &hourly, selected, &scroll);
+      } else {
+        for (i = 0; i < 14; i++) {
+          update_forecast_day(dw[i], &forecast, i, i == selected);
+        }
       }
-    } else {
-      update_current(cw, &observation, interval, t);
+
+      redraw = 0;
     }
 
     refresh();